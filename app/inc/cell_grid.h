@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "particle.h"
+
+// uniform grid over the particle bounding box, particles counting sorted by cell
+struct CellGrid {
+  glm::vec3 origin;
+  glm::vec3 cellWidth;                // >= requested cell size, wider when dims are capped
+  glm::ivec3 dims;
+  std::vector<uint32_t> cellOf;       // particle -> linear cell index
+  std::vector<uint32_t> cellStart;    // cell -> first slot in order, size cells + 1
+  std::vector<uint32_t> order;        // slot -> particle index, grouped by cell
+  std::vector<uint32_t> occupied;     // non empty cells, ascending
+};
+
+// build the grid, at most max_dim cells per axis
+void CGBuild(CellGrid &grid, const Particle *particles, size_t n, float cell_size,
+             int max_dim = 128, unsigned threads = 0);
+
+glm::ivec3 CGCellCoord(const CellGrid &grid, uint32_t cell);
+uint32_t CGCellIndex(const CellGrid &grid, glm::ivec3 coord);
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "particle.h"
+
+// Friends-of-friends group finder: particles closer than the linking length
+// share a group. Pairs come from a cell list, groups are merged with a lock
+// free union-find so every thread links its own cells without locking.
+struct FoFSettings {
+  float linkingLength = 0.0f; // 0 = FoFDefaultLinkingLength
+  uint32_t minMembers = 20;   // smaller groups are left out of the catalog
+  unsigned threads = 0;       // 0 = one per hardware thread
+};
+
+struct FoFGroup {
+  uint32_t members;
+  float mass;
+  glm::vec3 centre;     // centre of mass
+  glm::vec3 velocity;   // centre of mass velocity
+  float dispersion;     // mass weighted one dimensional velocity dispersion
+};
+
+// 0.2 x the mean interparticle spacing of the bounding box
+float FoFDefaultLinkingLength(const Particle *particles, size_t n);
+
+// groups ordered by member count, largest first
+std::vector<FoFGroup> FoFFind(const Particle *particles, size_t n, const FoFSettings &settings);
+
+// create or truncate the catalog file, called once before a run
+bool FoFResetCatalog(const std::filesystem::path &filename);
+
+// append one catalog to a binary file, see fof.cpp for the layout
+bool FoFWriteCatalog(const std::filesystem::path &filename, const std::vector<FoFGroup> &groups,
+                     uint64_t step, double time, float linking_length, size_t n);
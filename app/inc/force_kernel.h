@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "particle.h"
+
+// Direct sum force kernels specialised at compile time on softening, mass
+// model, accumulation precision and potential output. The engine picks one
+// instantiation per run, so the inner loop carries no per pair branches on
+// configuration and can be vectorised.
+
+enum class Softening {
+  None,    // 1 / r^2, coincident pairs contribute nothing
+  Plummer, // 1 / (r^2 + eps^2)
+  Spline,  // cubic spline, exact newtonian beyond h = 2.8 eps
+};
+
+enum class MassModel {
+  Uniform,     // every particle has the mass of particle 0
+  PerParticle,
+};
+
+struct ForceKernelConfig {
+  Softening softening = Softening::Plummer;
+  MassModel mass = MassModel::PerParticle;
+  float epsilon = 1e-3f;
+  float G = 6.67430e-11f;
+  bool fp64 = false;      // accumulate in double
+  bool potential = false; // also compute the potential per particle
+  unsigned threads = 0;   // 0 = one per hardware thread
+};
+
+// structure of arrays copy of the particles, kernels read and write these
+struct ForceArrays {
+  size_t n = 0;
+  std::vector<float> x, y, z, m;
+  std::vector<float> ax, ay, az, potential;
+};
+
+using ForceKernel = void (*)(ForceArrays &arrays, size_t begin, size_t end,
+                             const ForceKernelConfig &config);
+
+template <Softening S, MassModel M, typename Acc, bool Potential>
+void FKDirect(ForceArrays &arrays, size_t begin, size_t end, const ForceKernelConfig &config) {
+  const size_t n = arrays.n;
+  const float *x = arrays.x.data(), *y = arrays.y.data(), *z = arrays.z.data();
+  const float *m = arrays.m.data();
+  const float eps2 = config.epsilon * config.epsilon;
+  const float h_inv = 1.0f / (2.8f * config.epsilon);
+  const float h_inv3 = h_inv * h_inv * h_inv;
+
+  // G and a uniform mass factor out of the pair sum
+  const Acc scale = (Acc) config.G * (M == MassModel::Uniform ? (Acc) m[0] : (Acc) 1);
+
+  for (size_t i = begin; i < end; i++) {
+    const float xi = x[i], yi = y[i], zi = z[i];
+    Acc ax = 0, ay = 0, az = 0, pot = 0;
+
+#pragma omp simd reduction(+ : ax, ay, az, pot)
+    for (size_t j = 0; j < n; j++) {
+      float dx = x[j] - xi, dy = y[j] - yi, dz = z[j] - zi;
+      float r2 = dx * dx + dy * dy + dz * dz;
+      float mj = M == MassModel::PerParticle ? m[j] : 1.0f;
+      float fac, phi;
+
+      if constexpr (S == Softening::None) {
+        // evaluated for every lane then masked, so the select stays a blend
+        float inv = 1.0f / std::sqrt(std::max(r2, FLT_MIN));
+        inv = r2 > 0.0f ? inv : 0.0f;
+        fac = mj * inv * inv * inv;
+        phi = -mj * inv;
+      } else if constexpr (S == Softening::Plummer) {
+        float inv = 1.0f / std::sqrt(r2 + eps2);
+        fac = mj * inv * inv * inv;
+        phi = -mj * inv;
+      } else {
+        float r = std::sqrt(r2);
+        float u = r * h_inv;
+        float inv = 1.0f / std::max(r, FLT_MIN);
+        inv = r > 0.0f ? inv : 0.0f;
+        float um = std::max(u, 0.5f); // keeps 1 / u finite in lanes that use the inner branch
+        float inner = h_inv3 * (10.666666667f + u * u * (32.0f * u - 38.4f));
+        float middle = h_inv3 * (21.333333333f - 48.0f * u + 38.4f * u * u - 10.666666667f * u * u * u -
+                                 0.066666667f / (um * um * um));
+        fac = mj * (u < 0.5f ? inner : (u < 1.0f ? middle : inv * inv * inv));
+        float phi_inner = h_inv * (-2.8f + u * u * (5.333333333f + u * u * (6.4f * u - 9.6f)));
+        float phi_middle = h_inv * (-3.2f + 0.066666667f / um +
+                                    u * u * (10.666666667f + u * (-16.0f + u * (9.6f - 2.133333333f * u))));
+        phi = mj * (u < 0.5f ? phi_inner : (u < 1.0f ? phi_middle : -inv));
+      }
+
+      ax += (Acc) (dx * fac);
+      ay += (Acc) (dy * fac);
+      az += (Acc) (dz * fac);
+      if constexpr (Potential)
+        pot += (Acc) phi;
+    }
+
+    arrays.ax[i] = (float) (ax * scale);
+    arrays.ay[i] = (float) (ay * scale);
+    arrays.az[i] = (float) (az * scale);
+    if constexpr (Potential) {
+      // the loop includes j == i, take out exactly what it added
+      float mi = M == MassModel::PerParticle ? m[i] : 1.0f;
+      if constexpr (S == Softening::Plummer)
+        pot -= (Acc) (-mi * (1.0f / std::sqrt(eps2)));
+      else if constexpr (S == Softening::Spline)
+        pot -= (Acc) (mi * (h_inv * -2.8f));
+      arrays.potential[i] = (float) (pot * scale);
+    }
+  }
+}
+
+// resolve the configuration to one kernel instantiation
+ForceKernel FKSelect(const ForceKernelConfig &config);
+
+// exact cpu forces with a kernel chosen once at init
+struct DirectForce {
+  ForceKernelConfig config;
+  ForceKernel kernel = nullptr;
+  ForceArrays arrays;
+};
+
+void DFInit(DirectForce &force, const ForceKernelConfig &config);
+// fills force.arrays accelerations (and potential when configured)
+void DFCompute(DirectForce &force, const Particle *particles, size_t n);
+// same integration as nbody_c.glsl
+void DFStep(DirectForce &force, Particle *particles, size_t n, float deltaTime);
+// MassModel::Uniform when every particle has the same mass
+MassModel DFDetectMassModel(const Particle *particles, size_t n);
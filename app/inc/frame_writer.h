@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "soft_render.h"
+
+enum class FrameFormat {
+  Png, // frame_00000.png, frame_00001.png, ...
+  Raw, // frames.rgb, rgb24 frames back to back for ffmpeg -f rawvideo
+};
+
+// Background encoder, frames are queued and written on their own thread so
+// rendering the next frame overlaps with compressing and writing this one.
+struct FrameWriter {
+  std::filesystem::path directory;
+  FrameFormat format = FrameFormat::Png;
+  size_t maxQueued = 4; // submit blocks beyond this
+
+  std::deque<SoftFrame> queue;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::thread worker;
+  bool stopping = false;
+  std::ofstream rawFile;
+  size_t written = 0;
+  std::atomic<size_t> failed = 0; // set by the encoder thread
+};
+
+bool FWStart(FrameWriter &writer, const std::filesystem::path &directory, FrameFormat format);
+// false once any earlier frame failed to write
+bool FWSubmit(FrameWriter &writer, SoftFrame &&frame);
+// drain the queue and join the encoder thread, false if any frame failed to write
+bool FWStop(FrameWriter &writer);
+
+bool WritePng(const std::filesystem::path &filename, const SoftFrame &frame);
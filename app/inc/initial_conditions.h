@@ -0,0 +1,8 @@
+#pragma once
+#include <vector>
+
+#include "particle.h"
+
+// flattened disk orbiting a central mass at index 0, same seed gives same particles
+std::vector<Particle> InitialiseParticles(unsigned int n_particles, float G, float centralMass,
+                                          unsigned int seed = 1);
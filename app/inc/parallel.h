@@ -0,0 +1,32 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// resolve a requested thread count, 0 means one per hardware thread
+inline unsigned ThreadCount(unsigned requested) {
+  if (requested > 0)
+    return requested;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// split [0, n) into one contiguous chunk per thread and run fn(begin, end, thread)
+template <typename Fn> void ParallelFor(size_t n, unsigned threads, Fn fn) {
+  threads = (unsigned) std::min<size_t>(ThreadCount(threads), std::max<size_t>(n, 1));
+  if (threads == 1) {
+    fn((size_t) 0, n, 0u);
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  workers.reserve(threads);
+  size_t chunk = (n + threads - 1) / threads;
+  for (unsigned t = 0; t < threads; t++) {
+    size_t begin = std::min(n, t * chunk);
+    size_t end = std::min(n, begin + chunk);
+    workers.emplace_back(fn, begin, end, t);
+  }
+  for (auto &worker : workers)
+    worker.join();
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// Padded for std430 layout, shared with nbody_c.glsl
+struct Particle {
+  glm::vec4 position; // (x, y, z, w=mass)
+  glm::vec4 velocity; // (vx, vy, vz, w=padding)
+};
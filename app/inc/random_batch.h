@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "particle.h"
+
+// Stochastic force approximation: pairs in neighbouring cells of a cell list
+// are summed exactly, everything further away is estimated from a batch of
+// particles drawn with probability proportional to mass and reweighted.
+// Particles holding at least 1 / batchSize of the total mass are summed
+// exactly instead, so a dominant body does not swallow the batch.
+// Each cell draws its own batch from (seed, step, cell), so results are
+// reproducible and independent of the thread count.
+struct RandomBatchSettings {
+  float G = 6.67430e-11f;
+  float cutoff = 0.1f;     // near field cell size
+  unsigned batchSize = 64; // far field samples per cell, the accuracy knob
+  uint64_t seed = 1;
+  unsigned threads = 0;    // 0 = one per hardware thread
+};
+
+void RBComputeAccelerations(const Particle *particles, size_t n, glm::vec3 *acceleration,
+                            const RandomBatchSettings &settings, uint64_t step);
+
+// same integration as nbody_c.glsl with random batch accelerations
+void RBStep(Particle *particles, size_t n, float deltaTime, const RandomBatchSettings &settings,
+            uint64_t step);
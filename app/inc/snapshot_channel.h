@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "particle.h"
+
+// Shared memory ring of particle snapshots. One headless simulator publishes,
+// any number of viewer / analysis processes attach read only. Each slot is
+// guarded by a seqlock so the writer never waits on readers and readers
+// never copy, they read straight out of the mapping and validate afterwards.
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "seqlock needs lock free 64 bit atomics");
+
+struct SnapshotHeader {
+  uint64_t magic;
+  uint32_t slotCount;
+  uint32_t slotCapacity;             // particles per slot
+  uint64_t slotBytes;
+  std::atomic<uint64_t> latest;      // generation of the newest complete slot, 0 = none
+};
+
+struct SnapshotSlot {
+  std::atomic<uint64_t> sequence;    // odd while the writer is inside the slot
+  uint64_t generation;
+  uint64_t step;
+  double time;
+  uint64_t totalParticles;           // simulation size before level of detail
+  uint32_t count;                    // particles stored in this slot
+  uint32_t stride;                   // every stride-th particle was published
+  // Particle particles[slotCapacity] follows, 16 byte aligned
+};
+
+struct SnapshotChannel {
+  std::string name;
+  int fd = -1;
+  void *base = nullptr;
+  size_t bytes = 0;
+  bool writer = false;
+  uint64_t generation = 0;
+};
+
+struct SnapshotView {
+  const Particle *particles = nullptr;
+  uint32_t count = 0;
+  uint32_t stride = 1;
+  uint64_t totalParticles = 0;
+  uint64_t step = 0;
+  double time = 0.0;
+  uint64_t generation = 0;
+
+  const SnapshotSlot *slot = nullptr;
+  uint64_t sequence = 0;
+};
+
+// create (or replace) the named channel, capacity caps particles per snapshot
+bool SMCreate(SnapshotChannel &channel, const char *name, uint32_t slots, uint32_t capacity);
+// map an existing channel read only
+bool SMAttach(SnapshotChannel &channel, const char *name);
+// unmap, the writer also removes the name
+void SMClose(SnapshotChannel &channel);
+
+// publish n particles, strided down to the slot capacity when n is larger,
+// masses are left as simulated, each published particle stands in for stride
+void SMPublish(SnapshotChannel &channel, const Particle *particles, size_t n, uint64_t step,
+               double time, unsigned threads = 0);
+
+// view of the newest complete snapshot, false if none has been published yet
+bool SMAcquire(const SnapshotChannel &channel, SnapshotView &view);
+// true while the writer has not started overwriting the viewed slot,
+// check after reading to reject torn snapshots
+bool SMValid(const SnapshotView &view);
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "particle.h"
+
+// Headless cpu point splatting, draws what particle_v.glsl / particle_f.glsl
+// would for the same view and projection, without a GL context.
+enum class SplatBlend {
+  Overwrite,  // last particle wins, as with GL_BLEND disabled
+  Accumulate, // additive colour, scaled by exposure
+  Density,    // log scaled hit count tinted by mean speed
+};
+
+struct SoftRenderSettings {
+  int width = 1024;
+  int height = 1024;
+  int pointSize = 2; // gl_PointSize in particle_v.glsl
+  int tileSize = 64;
+  SplatBlend blend = SplatBlend::Overwrite;
+  float exposure = 0.25f;
+  unsigned threads = 0; // 0 = one per hardware thread
+};
+
+// packed rgb8, row 0 at the top
+struct SoftFrame {
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> rgb;
+};
+
+void SRRender(const Particle *particles, size_t n, const glm::mat4 &view,
+              const glm::mat4 &projection, const SoftRenderSettings &settings, SoftFrame &frame);
+
+// particle_f.glsl colour for a velocity
+glm::vec3 SRSpeedColour(glm::vec3 velocity);
@@ -0,0 +1,67 @@
+#include "cell_grid.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+
+void CGBuild(CellGrid &grid, const Particle *particles, size_t n, float cell_size, int max_dim,
+             unsigned threads) {
+  glm::vec3 lo(0.0f), hi(0.0f);
+  if (n > 0) {
+    lo = hi = glm::vec3(particles[0].position);
+    for (size_t i = 1; i < n; i++) {
+      glm::vec3 p = glm::vec3(particles[i].position);
+      lo = glm::min(lo, p);
+      hi = glm::max(hi, p);
+    }
+  }
+
+  glm::vec3 extent = hi - lo;
+  cell_size = std::max(cell_size, 1e-6f);
+  for (int a = 0; a < 3; a++) {
+    int cells = (int) std::ceil(extent[a] / cell_size);
+    grid.dims[a] = std::clamp(cells, 1, max_dim);
+    grid.cellWidth[a] = std::max(cell_size, extent[a] / (float) grid.dims[a]);
+  }
+  grid.origin = lo;
+
+  size_t n_cells = (size_t) grid.dims.x * grid.dims.y * grid.dims.z;
+  grid.cellOf.resize(n);
+  ParallelFor(n, threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      glm::vec3 rel = (glm::vec3(particles[i].position) - grid.origin);
+      glm::ivec3 coord;
+      for (int a = 0; a < 3; a++)
+        coord[a] = std::clamp((int) (rel[a] / grid.cellWidth[a]), 0, grid.dims[a] - 1);
+      grid.cellOf[i] = CGCellIndex(grid, coord);
+    }
+  });
+
+  // counting sort
+  grid.cellStart.assign(n_cells + 1, 0);
+  for (size_t i = 0; i < n; i++)
+    grid.cellStart[grid.cellOf[i] + 1]++;
+  grid.occupied.clear();
+  for (size_t c = 0; c < n_cells; c++) {
+    if (grid.cellStart[c + 1] > 0)
+      grid.occupied.push_back((uint32_t) c);
+    grid.cellStart[c + 1] += grid.cellStart[c];
+  }
+
+  std::vector<uint32_t> fill(grid.cellStart.begin(), grid.cellStart.end() - 1);
+  grid.order.resize(n);
+  for (size_t i = 0; i < n; i++)
+    grid.order[fill[grid.cellOf[i]]++] = (uint32_t) i;
+}
+
+glm::ivec3 CGCellCoord(const CellGrid &grid, uint32_t cell) {
+  int x = cell % grid.dims.x;
+  int y = (cell / grid.dims.x) % grid.dims.y;
+  int z = cell / (grid.dims.x * grid.dims.y);
+  return glm::ivec3(x, y, z);
+}
+
+uint32_t CGCellIndex(const CellGrid &grid, glm::ivec3 coord) {
+  return (uint32_t) ((coord.z * grid.dims.y + coord.y) * grid.dims.x + coord.x);
+}
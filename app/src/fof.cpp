@@ -0,0 +1,242 @@
+#include "fof.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "cell_grid.h"
+#include "parallel.h"
+
+// catalog file: a sequence of blocks, each
+//   CatalogHeader
+//   CatalogRecord[groups]
+struct CatalogHeader {
+  char magic[4]; // "FOF1"
+  uint32_t groups;
+  uint64_t step;
+  double time;
+  uint64_t particles;
+  float linkingLength;
+  uint32_t padding;
+};
+
+struct CatalogRecord {
+  uint32_t members;
+  float mass;
+  float centre[3];
+  float velocity[3];
+  float dispersion;
+};
+
+// roots always link to the smaller index, so the structure stays a forest
+// no matter how concurrent unions interleave
+static uint32_t Find(std::atomic<uint32_t> *parent, uint32_t i) {
+  while (true) {
+    uint32_t p = parent[i].load(std::memory_order_relaxed);
+    if (p == i)
+      return i;
+    uint32_t gp = parent[p].load(std::memory_order_relaxed);
+    if (gp != p)
+      parent[i].compare_exchange_weak(p, gp, std::memory_order_relaxed); // path halving
+    i = gp;
+  }
+}
+
+static void Union(std::atomic<uint32_t> *parent, uint32_t a, uint32_t b) {
+  while (true) {
+    a = Find(parent, a);
+    b = Find(parent, b);
+    if (a == b)
+      return;
+    if (a < b)
+      std::swap(a, b);
+    uint32_t expected = a;
+    if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+      return;
+  }
+}
+
+float FoFDefaultLinkingLength(const Particle *particles, size_t n) {
+  if (n == 0)
+    return 0.0f;
+
+  glm::vec3 lo = glm::vec3(particles[0].position), hi = lo;
+  for (size_t i = 1; i < n; i++) {
+    lo = glm::min(lo, glm::vec3(particles[i].position));
+    hi = glm::max(hi, glm::vec3(particles[i].position));
+  }
+
+  // flat systems would collapse the box volume, floor each side
+  glm::vec3 extent = glm::max(hi - lo, glm::vec3(1e-3f * glm::length(hi - lo) + 1e-6f));
+  return 0.2f * std::cbrt(extent.x * extent.y * extent.z / (float) n);
+}
+
+std::vector<FoFGroup> FoFFind(const Particle *particles, size_t n, const FoFSettings &settings) {
+  std::vector<FoFGroup> groups;
+  if (n == 0)
+    return groups;
+
+  float link = settings.linkingLength;
+  if (link <= 0.0f)
+    link = FoFDefaultLinkingLength(particles, n);
+
+  CellGrid grid;
+  CGBuild(grid, particles, n, link, 256, settings.threads);
+  float link_sq = link * link;
+
+  std::unique_ptr<std::atomic<uint32_t>[]> parent(new std::atomic<uint32_t>[n]);
+  ParallelFor(n, settings.threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++)
+      parent[i].store((uint32_t) i, std::memory_order_relaxed);
+  });
+
+  std::vector<glm::vec3> sorted(n);
+  ParallelFor(n, settings.threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t s = begin; s < end; s++)
+      sorted[s] = glm::vec3(particles[grid.order[s]].position);
+  });
+
+  // half shell of neighbour cells, each cell pair is visited once
+  static const int shell[13][3] = {{1, 0, 0},  {-1, 1, 0}, {0, 1, 0},  {1, 1, 0},  {-1, -1, 1},
+                                   {0, -1, 1}, {1, -1, 1}, {-1, 0, 1}, {0, 0, 1},  {1, 0, 1},
+                                   {-1, 1, 1}, {0, 1, 1},  {1, 1, 1}};
+
+  ParallelFor(grid.occupied.size(), settings.threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t o = begin; o < end; o++) {
+      uint32_t cell = grid.occupied[o];
+      glm::ivec3 coord = CGCellCoord(grid, cell);
+      uint32_t first = grid.cellStart[cell], last = grid.cellStart[cell + 1];
+
+      for (uint32_t s = first; s < last; s++) {
+        for (uint32_t t = s + 1; t < last; t++) {
+          glm::vec3 d = sorted[t] - sorted[s];
+          if (glm::dot(d, d) <= link_sq)
+            Union(parent.get(), grid.order[s], grid.order[t]);
+        }
+      }
+
+      for (const int *offset : shell) {
+        glm::ivec3 other = coord + glm::ivec3(offset[0], offset[1], offset[2]);
+        if (other.x < 0 || other.y < 0 || other.z < 0 || other.x >= grid.dims.x ||
+            other.y >= grid.dims.y || other.z >= grid.dims.z)
+          continue;
+        uint32_t neighbour = CGCellIndex(grid, other);
+        for (uint32_t s = first; s < last; s++) {
+          for (uint32_t t = grid.cellStart[neighbour]; t < grid.cellStart[neighbour + 1]; t++) {
+            glm::vec3 d = sorted[t] - sorted[s];
+            if (glm::dot(d, d) <= link_sq)
+              Union(parent.get(), grid.order[s], grid.order[t]);
+          }
+        }
+      }
+    }
+  });
+
+  // flatten, then number the roots of groups large enough to report
+  std::vector<uint32_t> root(n);
+  ParallelFor(n, settings.threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++)
+      root[i] = Find(parent.get(), (uint32_t) i);
+  });
+
+  std::vector<uint32_t> size(n, 0);
+  for (size_t i = 0; i < n; i++)
+    size[root[i]]++;
+
+  std::vector<uint32_t> group_of_root(n, UINT32_MAX);
+  std::vector<uint32_t> group_start(1, 0);
+  for (size_t i = 0; i < n; i++) {
+    if (root[i] == i && size[i] >= std::max(settings.minMembers, 1u)) {
+      group_of_root[i] = (uint32_t) (group_start.size() - 1);
+      group_start.push_back(group_start.back() + size[i]);
+    }
+  }
+  size_t n_groups = group_start.size() - 1;
+
+  // members grouped contiguously so each group reduces on one thread
+  std::vector<uint32_t> members(group_start.back());
+  std::vector<uint32_t> fill(group_start.begin(), group_start.end() - 1);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t g = group_of_root[root[i]];
+    if (g != UINT32_MAX)
+      members[fill[g]++] = (uint32_t) i;
+  }
+
+  groups.resize(n_groups);
+  ParallelFor(n_groups, settings.threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t g = begin; g < end; g++) {
+      double mass = 0.0;
+      glm::dvec3 centre(0.0), velocity(0.0);
+      for (uint32_t k = group_start[g]; k < group_start[g + 1]; k++) {
+        const Particle &p = particles[members[k]];
+        mass += p.position.w;
+        centre += glm::dvec3(glm::vec3(p.position)) * (double) p.position.w;
+        velocity += glm::dvec3(glm::vec3(p.velocity)) * (double) p.position.w;
+      }
+      if (mass > 0.0) {
+        centre /= mass;
+        velocity /= mass;
+      }
+
+      double spread = 0.0;
+      for (uint32_t k = group_start[g]; k < group_start[g + 1]; k++) {
+        const Particle &p = particles[members[k]];
+        glm::dvec3 dv = glm::dvec3(glm::vec3(p.velocity)) - velocity;
+        spread += glm::dot(dv, dv) * (double) p.position.w;
+      }
+
+      FoFGroup &group = groups[g];
+      group.members = group_start[g + 1] - group_start[g];
+      group.mass = (float) mass;
+      group.centre = glm::vec3(centre);
+      group.velocity = glm::vec3(velocity);
+      group.dispersion = mass > 0.0 ? (float) std::sqrt(spread / (3.0 * mass)) : 0.0f;
+    }
+  });
+
+  std::stable_sort(groups.begin(), groups.end(),
+                   [](const FoFGroup &a, const FoFGroup &b) { return a.members > b.members; });
+  return groups;
+}
+
+bool FoFResetCatalog(const std::filesystem::path &filename) {
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    std::cerr << "Error: Failed to create group catalog: " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool FoFWriteCatalog(const std::filesystem::path &filename, const std::vector<FoFGroup> &groups,
+                     uint64_t step, double time, float linking_length, size_t n) {
+  std::ofstream file(filename, std::ios::binary | std::ios::app);
+  if (!file.is_open()) {
+    std::cerr << "Error: Failed to open group catalog: " << filename << std::endl;
+    return false;
+  }
+
+  CatalogHeader header = {{'F', 'O', 'F', '1'}, (uint32_t) groups.size(), step, time, n,
+                          linking_length, 0};
+  file.write((const char *) &header, sizeof(header));
+
+  for (const FoFGroup &group : groups) {
+    CatalogRecord record = {group.members,
+                            group.mass,
+                            {group.centre.x, group.centre.y, group.centre.z},
+                            {group.velocity.x, group.velocity.y, group.velocity.z},
+                            group.dispersion};
+    file.write((const char *) &record, sizeof(record));
+  }
+
+  // close flushes, so a full disk shows up here rather than being lost
+  file.close();
+  if (file.fail()) {
+    std::cerr << "Error: Failed to write group catalog: " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
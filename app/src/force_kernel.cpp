@@ -0,0 +1,80 @@
+#include "force_kernel.h"
+
+#include "parallel.h"
+
+template <Softening S, MassModel M, typename Acc> static ForceKernel SelectPotential(bool potential) {
+  return potential ? &FKDirect<S, M, Acc, true> : &FKDirect<S, M, Acc, false>;
+}
+
+template <Softening S, MassModel M> static ForceKernel SelectPrecision(const ForceKernelConfig &config) {
+  return config.fp64 ? SelectPotential<S, M, double>(config.potential)
+                     : SelectPotential<S, M, float>(config.potential);
+}
+
+template <Softening S> static ForceKernel SelectMass(const ForceKernelConfig &config) {
+  return config.mass == MassModel::Uniform ? SelectPrecision<S, MassModel::Uniform>(config)
+                                           : SelectPrecision<S, MassModel::PerParticle>(config);
+}
+
+ForceKernel FKSelect(const ForceKernelConfig &config) {
+  switch (config.softening) {
+  case Softening::None:
+    return SelectMass<Softening::None>(config);
+  case Softening::Plummer:
+    return SelectMass<Softening::Plummer>(config);
+  case Softening::Spline:
+    return SelectMass<Softening::Spline>(config);
+  }
+  return nullptr;
+}
+
+void DFInit(DirectForce &force, const ForceKernelConfig &config) {
+  force.config = config;
+  force.kernel = FKSelect(config);
+}
+
+void DFCompute(DirectForce &force, const Particle *particles, size_t n) {
+  ForceArrays &a = force.arrays;
+  a.n = n;
+  for (auto *v : {&a.x, &a.y, &a.z, &a.m, &a.ax, &a.ay, &a.az})
+    v->resize(n);
+  if (force.config.potential)
+    a.potential.resize(n);
+  // the kernels read m[0] for the uniform mass scale
+  if (n == 0)
+    return;
+
+  ParallelFor(n, force.config.threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      a.x[i] = particles[i].position.x;
+      a.y[i] = particles[i].position.y;
+      a.z[i] = particles[i].position.z;
+      a.m[i] = particles[i].position.w;
+    }
+  });
+
+  ParallelFor(n, force.config.threads, [&](size_t begin, size_t end, unsigned) {
+    force.kernel(a, begin, end, force.config);
+  });
+}
+
+void DFStep(DirectForce &force, Particle *particles, size_t n, float deltaTime) {
+  DFCompute(force, particles, n);
+
+  const ForceArrays &a = force.arrays;
+  ParallelFor(n, force.config.threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      glm::vec3 velocity = glm::vec3(particles[i].velocity) + glm::vec3(a.ax[i], a.ay[i], a.az[i]) * deltaTime;
+      particles[i].velocity = glm::vec4(velocity, particles[i].velocity.w);
+      particles[i].position = glm::vec4(glm::vec3(particles[i].position) + velocity * deltaTime,
+                                        particles[i].position.w);
+    }
+  });
+}
+
+MassModel DFDetectMassModel(const Particle *particles, size_t n) {
+  for (size_t i = 1; i < n; i++)
+    if (particles[i].position.w != particles[0].position.w)
+      return MassModel::PerParticle;
+  return MassModel::Uniform;
+}
@@ -0,0 +1,194 @@
+#include "frame_writer.h"
+
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef NBODY_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+static uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t length) {
+  static const std::array<uint32_t, 256> table = [] {
+    std::array<uint32_t, 256> t;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void PutBigEndian(std::vector<uint8_t> &out, uint32_t v) {
+  out.push_back(v >> 24);
+  out.push_back(v >> 16);
+  out.push_back(v >> 8);
+  out.push_back(v);
+}
+
+static void PutChunk(std::ofstream &file, const char *type, const std::vector<uint8_t> &data) {
+  std::vector<uint8_t> chunk;
+  PutBigEndian(chunk, (uint32_t) data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  PutBigEndian(chunk, Crc32(0, chunk.data() + 4, chunk.size() - 4));
+  file.write((const char *) chunk.data(), chunk.size());
+}
+
+// zlib stream of the filtered scanlines
+static std::vector<uint8_t> Deflate(const std::vector<uint8_t> &raw) {
+#ifdef NBODY_HAVE_ZLIB
+  uLongf length = compressBound(raw.size());
+  std::vector<uint8_t> out(length);
+  compress2(out.data(), &length, raw.data(), raw.size(), Z_BEST_SPEED);
+  out.resize(length);
+  return out;
+#else
+  // stored deflate blocks, valid png without a zlib dependency
+  std::vector<uint8_t> out = {0x78, 0x01};
+  size_t pos = 0;
+  do {
+    size_t block = std::min<size_t>(raw.size() - pos, 65535);
+    bool last = pos + block == raw.size();
+    out.push_back(last ? 1 : 0);
+    out.push_back(block & 0xff);
+    out.push_back(block >> 8);
+    out.push_back(~block & 0xff);
+    out.push_back((~block >> 8) & 0xff);
+    out.insert(out.end(), raw.begin() + pos, raw.begin() + pos + block);
+    pos += block;
+  } while (pos < raw.size());
+
+  uint32_t a = 1, b = 0;
+  for (uint8_t v : raw) {
+    a = (a + v) % 65521;
+    b = (b + a) % 65521;
+  }
+  PutBigEndian(out, (b << 16) | a);
+  return out;
+#endif
+}
+
+bool WritePng(const std::filesystem::path &filename, const SoftFrame &frame) {
+  std::ofstream file(filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Error: Failed to open frame file: " << filename << std::endl;
+    return false;
+  }
+
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  file.write((const char *) signature, sizeof(signature));
+
+  std::vector<uint8_t> header;
+  PutBigEndian(header, frame.width);
+  PutBigEndian(header, frame.height);
+  header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit rgb, no interlace
+  PutChunk(file, "IHDR", header);
+
+  // filter type 0 per scanline
+  size_t stride = (size_t) frame.width * 3;
+  std::vector<uint8_t> raw;
+  raw.reserve((stride + 1) * frame.height);
+  for (int y = 0; y < frame.height; y++) {
+    raw.push_back(0);
+    raw.insert(raw.end(), frame.rgb.begin() + y * stride, frame.rgb.begin() + (y + 1) * stride);
+  }
+  PutChunk(file, "IDAT", Deflate(raw));
+  PutChunk(file, "IEND", {});
+
+  return file.good();
+}
+
+static void EncodeLoop(FrameWriter *writer) {
+  while (true) {
+    SoftFrame frame;
+    {
+      std::unique_lock<std::mutex> lock(writer->mutex);
+      writer->changed.wait(lock, [&] { return writer->stopping || !writer->queue.empty(); });
+      if (writer->queue.empty())
+        return;
+      frame = std::move(writer->queue.front());
+      writer->queue.pop_front();
+    }
+    writer->changed.notify_all();
+
+    bool ok;
+    if (writer->format == FrameFormat::Raw) {
+      writer->rawFile.write((const char *) frame.rgb.data(), frame.rgb.size());
+      ok = writer->rawFile.good();
+    } else {
+      char name[32];
+      snprintf(name, sizeof(name), "frame_%05zu.png", writer->written);
+      ok = WritePng(writer->directory / name, frame);
+    }
+    writer->written++;
+    if (!ok)
+      writer->failed++;
+  }
+}
+
+bool FWStart(FrameWriter &writer, const std::filesystem::path &directory, FrameFormat format) {
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    std::cerr << "Error: Failed to create frame directory: " << directory << std::endl;
+    return false;
+  }
+
+  writer.directory = directory;
+  writer.format = format;
+  writer.stopping = false;
+  writer.written = 0;
+  writer.failed = 0;
+
+  if (format == FrameFormat::Raw) {
+    writer.rawFile.open(directory / "frames.rgb", std::ios::binary | std::ios::trunc);
+    if (!writer.rawFile.is_open()) {
+      std::cerr << "Error: Failed to open frame file: " << directory / "frames.rgb" << std::endl;
+      return false;
+    }
+  }
+
+  writer.worker = std::thread(EncodeLoop, &writer);
+  return true;
+}
+
+bool FWSubmit(FrameWriter &writer, SoftFrame &&frame) {
+  {
+    std::unique_lock<std::mutex> lock(writer.mutex);
+    writer.changed.wait(lock, [&] { return writer.queue.size() < writer.maxQueued; });
+    if (writer.failed > 0)
+      return false;
+    writer.queue.push_back(std::move(frame));
+  }
+  writer.changed.notify_all();
+  return true;
+}
+
+bool FWStop(FrameWriter &writer) {
+  {
+    std::lock_guard<std::mutex> lock(writer.mutex);
+    writer.stopping = true;
+  }
+  writer.changed.notify_all();
+  if (writer.worker.joinable())
+    writer.worker.join();
+  if (writer.rawFile.is_open())
+    writer.rawFile.close();
+
+  if (writer.failed > 0) {
+    std::cerr << "Error: Failed to write " << writer.failed << " of " << writer.written
+              << " frames to " << writer.directory << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,43 @@
+#include "initial_conditions.h"
+
+#include <cmath>
+#include <stdlib.h>
+
+std::vector<Particle> InitialiseParticles(unsigned int n_particles, float G, float centralMass,
+                                          unsigned int seed) {
+  srand(seed);
+  std::vector<Particle> particles(n_particles);
+  for (size_t i = 0; i < n_particles; i++) {
+    glm::vec3 velocity;
+    float x, y, z, w;
+    float theta, phi, r;
+
+    if (i == 0) {
+      particles[i].position = glm::vec4(0.0f, 0.0f, 0.0f, centralMass);
+      particles[i].velocity = glm::vec4(0.0f);
+    } else {
+      theta = ((float) rand() / (float) RAND_MAX) * 2.0f * M_PI;
+      phi = acos((2.0f * ((float) rand() / (float) RAND_MAX)) - 1.0f);
+      r = cbrt((float) rand() / (float) RAND_MAX);
+
+      x = r * sin(phi) * cos(theta);
+      y = ((r * 0.05) * sin(phi) * sin(theta));
+      z = r * cos(phi);
+      w = 2e3f;
+
+      // Compute perpendicular velocity direction
+      glm::vec3 radial_direction = glm::normalize(glm::vec3(x, y, z));
+      glm::vec3 arbitrary_axis = glm::vec3(0, 1, 0);
+      glm::vec3 tangent_velocity = glm::normalize(glm::cross(radial_direction, arbitrary_axis));
+
+      // Compute orbital velocity
+      float distance = glm::length(glm::vec2(x, z));
+      float orbital_speed = sqrt((G * centralMass) / (distance + 1e-6f));
+
+      velocity = tangent_velocity * orbital_speed;
+      particles[i].position = glm::vec4(x, y, z, w);
+      particles[i].velocity = glm::vec4(velocity, 0.0f);
+    }
+  }
+  return particles;
+}
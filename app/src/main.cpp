@@ -8,12 +8,24 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "callback_handle.h"
+#include "fof.h"
+#include "force_kernel.h"
+#include "frame_writer.h"
+#include "initial_conditions.h"
 #include "orbit_camera.h"
+#include "particle.h"
+#include "random_batch.h"
 #include "shader.h"
+#include "snapshot_channel.h"
+#include "soft_render.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <filesystem>
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 
 GLuint window_w = 1024, window_h = 1024;
@@ -22,6 +34,41 @@ GLuint particleShader;
 float deltaTime = 0.0;
 bool space_pressed = false;
 
+// M toggles between the exact compute shader and the cpu random batch approximation
+bool random_batch = false;
+RandomBatchSettings rbSettings;
+uint64_t simStep = 0;
+
+// headless physics has no default, --force random-batch or --force direct must be given
+bool forceChosen = false;
+bool directForce = false;
+ForceKernelConfig forceConfig;
+
+// --headless renders on the cpu and writes frames instead of opening a window
+bool headless = false;
+int headlessFrames = 600;
+int stepsPerFrame = 1;
+std::filesystem::path frameDirectory = "frames";
+FrameFormat frameFormat = FrameFormat::Png;
+SoftRenderSettings renderSettings;
+bool renderFrames = true;
+
+// --publish streams headless snapshots into shared memory, --attach views them
+const char *publishName = nullptr;
+const char *attachName = nullptr;
+uint32_t snapshotSlots = 4;
+uint32_t snapshotCapacity = 0; // 0 = every particle
+SnapshotChannel channel;
+uint64_t attachedGeneration = 0;
+GLuint stagingBuffer = 0;
+GLsizeiptr stagingSize = 0;
+
+// --fof-every k runs the group finder on the live headless particles every k steps
+int fofEvery = 0;
+FoFSettings fofSettings;
+std::filesystem::path fofCatalogPath = "groups.fof";
+
+unsigned int n_particles = 256 * 20;
 float G = 6.67430e-11f;
 float centralMass = 1e9f;
 
@@ -29,12 +76,6 @@ static const std::filesystem::path computeShaderPath = "app/shaders/nbody_c.glsl
 static const std::filesystem::path vertexShaderPath = "app/shaders/particle_v.glsl";
 static const std::filesystem::path fragmentShaderPath = "app/shaders/particle_f.glsl";
 
-// Padded for std430 layout
-struct Particle {
-  glm::vec4 position; // (x, y, z, w=mass)
-  glm::vec4 velocity; // (vx, vy, vz, w=padding)
-};
-
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mode) {
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
     glfwSetWindowShouldClose(window, GL_TRUE);
@@ -49,6 +90,11 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
       particleShader = newParticleShader;
   }
 
+  if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+    random_batch = !random_batch;
+    std::cout << "Force mode: " << (random_batch ? "random batch" : "exact") << std::endl;
+  }
+
   if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
     space_pressed = true;
   if (key == GLFW_KEY_SPACE && action == GLFW_RELEASE)
@@ -79,7 +125,276 @@ void APIENTRY MessageCallback(GLenum source, GLenum type, GLuint id, GLenum seve
   std::cerr << "debug: " << message << std::endl;
 }
 
-int main(void) {
+// set by SIGINT / SIGTERM, the headless loop finishes its frame and cleans up
+volatile std::sig_atomic_t stopRequested = 0;
+
+void RequestStop(int) { stopRequested = 1; }
+
+// cpu physics with software rendered frames, no window or GL context needed
+int RunHeadless() {
+  if (!forceChosen) {
+    std::cerr << "Error: headless runs need --force random-batch or --force direct" << std::endl;
+    return 1;
+  }
+  std::cout << "Force mode: " << (directForce ? "direct" : "random batch") << std::endl;
+
+  std::vector<Particle> particles = InitialiseParticles(n_particles, G, centralMass);
+
+  float window_ratio = (float) renderSettings.width / (float) renderSettings.height;
+  OCSetProjection(glm::perspective(glm::radians(45.0f), window_ratio, 0.1f, 100.0f));
+
+  // the shared memory segment outlives the process unless unlinked, so the
+  // channel is closed on every exit path and a kill ends the run cleanly
+  struct ChannelGuard {
+    ~ChannelGuard() { SMClose(channel); }
+  } channelGuard;
+  std::signal(SIGINT, RequestStop);
+  std::signal(SIGTERM, RequestStop);
+
+  uint32_t capacity = snapshotCapacity > 0 ? std::min(snapshotCapacity, n_particles) : n_particles;
+  if (publishName && !SMCreate(channel, publishName, snapshotSlots, capacity))
+    return 1;
+
+  // catalogs from earlier runs are dropped, this run appends to a fresh file
+  if (fofEvery > 0 && !FoFResetCatalog(fofCatalogPath))
+    return 1;
+
+  FrameWriter writer;
+  if (renderFrames && !FWStart(writer, frameDirectory, frameFormat))
+    return 1;
+
+  // kernel instantiation is chosen once for the whole run
+  DirectForce force;
+  if (directForce) {
+    forceConfig.G = G;
+    forceConfig.mass = DFDetectMassModel(particles.data(), n_particles);
+    DFInit(force, forceConfig);
+  }
+
+  // --frames 0 runs until interrupted
+  double renderTimeSum = 0.0;
+  bool catalogFailed = false;
+  for (int frame = 0; !stopRequested && (headlessFrames <= 0 || frame < headlessFrames); frame++) {
+    for (int step = 0; step < stepsPerFrame; step++) {
+      if (directForce)
+        DFStep(force, particles.data(), n_particles, deltaTime);
+      else
+        RBStep(particles.data(), n_particles, deltaTime, rbSettings, simStep);
+      simStep++;
+
+      if (fofEvery > 0 && simStep % fofEvery == 0) {
+        float link = fofSettings.linkingLength > 0.0f
+                         ? fofSettings.linkingLength
+                         : FoFDefaultLinkingLength(particles.data(), n_particles);
+        FoFSettings settings = fofSettings;
+        settings.linkingLength = link;
+        std::vector<FoFGroup> groups = FoFFind(particles.data(), n_particles, settings);
+        if (!FoFWriteCatalog(fofCatalogPath, groups, simStep, simStep * (double) deltaTime, link,
+                             n_particles)) {
+          catalogFailed = true;
+          break;
+        }
+      }
+    }
+    if (catalogFailed)
+      break;
+
+    if (publishName)
+      SMPublish(channel, particles.data(), n_particles, simStep, simStep * (double) deltaTime);
+
+    // energy from the potential of the last force evaluation
+    if (directForce && forceConfig.potential && (frame + 1) % 100 == 0) {
+      double kinetic = 0.0, potential = 0.0;
+      for (size_t i = 0; i < n_particles; i++) {
+        glm::vec3 v = glm::vec3(particles[i].velocity);
+        kinetic += 0.5 * particles[i].position.w * glm::dot(v, v);
+        potential += 0.5 * particles[i].position.w * force.arrays.potential[i];
+      }
+      std::cout << "Frame " << frame + 1 << ", energy: " << kinetic + potential << std::endl;
+    }
+    if (!renderFrames)
+      continue;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    OCSetTarget(glm::vec3(particles[0].position));
+    SoftFrame image;
+    SRRender(particles.data(), n_particles, OCGetView(), OCGetProjection(), renderSettings, image);
+    if (!FWSubmit(writer, std::move(image)))
+      break;
+    auto end = std::chrono::high_resolution_clock::now();
+
+    renderTimeSum += std::chrono::duration<double>(end - start).count();
+    if ((frame + 1) % 100 == 0) {
+      std::cout << "Frame " << frame + 1 << ", avg render: " << renderTimeSum * 10.0 << " ms"
+                << std::endl;
+      renderTimeSum = 0.0;
+    }
+  }
+
+  if (stopRequested)
+    std::cout << "Stopped at step " << simStep << std::endl;
+  bool written = FWStop(writer);
+  return written && !catalogFailed ? 0 : 1;
+}
+
+// upload the newest published snapshot straight from shared memory into a
+// staging buffer, the ssbo only takes it once the seqlock confirms it is whole
+void UploadLatestSnapshot(GLuint ssbo) {
+  SnapshotView view;
+  if (!SMAcquire(channel, view) || view.generation == attachedGeneration)
+    return;
+
+  GLsizeiptr bytes = view.count * sizeof(Particle);
+  if (stagingBuffer == 0)
+    glGenBuffers(1, &stagingBuffer);
+  glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+  if (bytes != stagingSize) {
+    glBufferData(GL_COPY_READ_BUFFER, bytes, view.particles, GL_STREAM_DRAW);
+    stagingSize = bytes;
+  } else {
+    glBufferSubData(GL_COPY_READ_BUFFER, 0, bytes, view.particles);
+  }
+  glm::vec3 target = glm::vec3(view.particles[0].position);
+
+  // writer lapped the ring mid upload, keep drawing the previous snapshot
+  if (!SMValid(view)) {
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    return;
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, ssbo);
+  if (view.count != n_particles)
+    glBufferData(GL_COPY_WRITE_BUFFER, bytes, nullptr, GL_DYNAMIC_DRAW);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, bytes);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  n_particles = view.count;
+  attachedGeneration = view.generation;
+  OCSetTarget(target);
+}
+
+// false when an option has a value it does not recognise
+bool ParseArguments(int argc, char **argv) {
+  bool valid = true;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : "";
+
+    if (strcmp(arg, "--headless") == 0) {
+      headless = true;
+      continue;
+    }
+    if (strcmp(arg, "--no-render") == 0) {
+      renderFrames = false;
+      continue;
+    }
+    if (strcmp(arg, "--fp64") == 0) {
+      forceConfig.fp64 = true;
+      continue;
+    }
+    if (strcmp(arg, "--potential") == 0) {
+      forceConfig.potential = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--particles") == 0)
+      n_particles = atoi(value);
+    else if (strcmp(arg, "--dt") == 0)
+      deltaTime = atof(value);
+    else if (strcmp(arg, "--batch") == 0)
+      rbSettings.batchSize = atoi(value);
+    else if (strcmp(arg, "--cutoff") == 0)
+      rbSettings.cutoff = atof(value);
+    else if (strcmp(arg, "--seed") == 0)
+      rbSettings.seed = strtoull(value, nullptr, 10);
+    else if (strcmp(arg, "--frames") == 0)
+      headlessFrames = atoi(value);
+    else if (strcmp(arg, "--steps-per-frame") == 0)
+      stepsPerFrame = atoi(value);
+    else if (strcmp(arg, "--out") == 0)
+      frameDirectory = value;
+    else if (strcmp(arg, "--format") == 0) {
+      if (strcmp(value, "png") == 0)
+        frameFormat = FrameFormat::Png;
+      else if (strcmp(value, "raw") == 0)
+        frameFormat = FrameFormat::Raw;
+      else {
+        std::cerr << "Unknown frame format: " << value << std::endl;
+        valid = false;
+      }
+    }
+    else if (strcmp(arg, "--size") == 0)
+      sscanf(value, "%dx%d", &renderSettings.width, &renderSettings.height);
+    else if (strcmp(arg, "--blend") == 0) {
+      if (strcmp(value, "overwrite") == 0)
+        renderSettings.blend = SplatBlend::Overwrite;
+      else if (strcmp(value, "accumulate") == 0)
+        renderSettings.blend = SplatBlend::Accumulate;
+      else if (strcmp(value, "density") == 0)
+        renderSettings.blend = SplatBlend::Density;
+      else {
+        std::cerr << "Unknown blend mode: " << value << std::endl;
+        valid = false;
+      }
+    }
+    else if (strcmp(arg, "--exposure") == 0)
+      renderSettings.exposure = atof(value);
+    else if (strcmp(arg, "--publish") == 0)
+      publishName = value;
+    else if (strcmp(arg, "--attach") == 0)
+      attachName = value;
+    else if (strcmp(arg, "--slots") == 0)
+      snapshotSlots = std::max(1, atoi(value));
+    else if (strcmp(arg, "--lod") == 0)
+      snapshotCapacity = atoi(value);
+    else if (strcmp(arg, "--force") == 0) {
+      forceChosen = strcmp(value, "direct") == 0 || strcmp(value, "random-batch") == 0;
+      directForce = strcmp(value, "direct") == 0;
+      if (!forceChosen) {
+        std::cerr << "Unknown force mode: " << value << std::endl;
+        valid = false;
+      }
+    }
+    else if (strcmp(arg, "--softening") == 0) {
+      if (strcmp(value, "none") == 0)
+        forceConfig.softening = Softening::None;
+      else if (strcmp(value, "plummer") == 0)
+        forceConfig.softening = Softening::Plummer;
+      else if (strcmp(value, "spline") == 0)
+        forceConfig.softening = Softening::Spline;
+      else {
+        std::cerr << "Unknown softening: " << value << std::endl;
+        valid = false;
+      }
+    }
+    else if (strcmp(arg, "--eps") == 0)
+      forceConfig.epsilon = atof(value);
+    else if (strcmp(arg, "--fof-every") == 0)
+      fofEvery = atoi(value);
+    else if (strcmp(arg, "--fof-link") == 0)
+      fofSettings.linkingLength = atof(value);
+    else if (strcmp(arg, "--fof-min") == 0)
+      fofSettings.minMembers = atoi(value);
+    else if (strcmp(arg, "--fof-out") == 0)
+      fofCatalogPath = value;
+    else {
+      std::cerr << "Unknown argument: " << arg << std::endl;
+      continue;
+    }
+    i++;
+  }
+  return valid;
+}
+
+int main(int argc, char **argv) {
+  bool argumentsValid = ParseArguments(argc, argv);
+  rbSettings.G = G;
+  if (headless)
+    return argumentsValid ? RunHeadless() : 1;
+  if (attachName && !SMAttach(channel, attachName))
+    return 1;
+
   glfwInit();
 
   // Initialise window
@@ -134,41 +449,10 @@ int main(void) {
   if (particleShader == GL_INVALID_INDEX)
     exit(1);
 
-  // Initialise particles
-  unsigned int n_particles = 256 * 20;
-  std::vector<Particle> particles(n_particles);
-  for (size_t i = 0; i < n_particles; i++) {
-    glm::vec3 velocity;
-    float x, y, z, w;
-    float theta, phi, r;
-
-    if (i == 0) {
-      particles[i].position = glm::vec4(0.0f, 0.0f, 0.0f, centralMass);
-      particles[i].velocity = glm::vec4(0.0f);
-    } else {
-      theta = ((float) rand() / (float) RAND_MAX) * 2.0f * M_PI;
-      phi = acos((2.0f * ((float) rand() / (float) RAND_MAX)) - 1.0f);
-      r = cbrt((float) rand() / (float) RAND_MAX);
-
-      x = r * sin(phi) * cos(theta);
-      y = ((r * 0.05) * sin(phi) * sin(theta));
-      z = r * cos(phi);
-      w = 2e3f;
-
-      // Compute perpendicular velocity direction
-      glm::vec3 radial_direction = glm::normalize(glm::vec3(x, y, z));
-      glm::vec3 arbitrary_axis = glm::vec3(0, 1, 0);
-      glm::vec3 tangent_velocity = glm::normalize(glm::cross(radial_direction, arbitrary_axis));
-
-      // Compute orbital velocity
-      float distance = glm::length(glm::vec2(x, z));
-      float orbital_speed = sqrt((G * centralMass) / (distance + 1e-6f));
-
-      velocity = tangent_velocity * orbital_speed;
-      particles[i].position = glm::vec4(x, y, z, w);
-      particles[i].velocity = glm::vec4(velocity, 0.0f);
-    }
-  }
+  // Initialise particles, attached viewers start empty until the first snapshot
+  if (attachName)
+    n_particles = 1;
+  std::vector<Particle> particles = InitialiseParticles(n_particles, G, centralMass);
 
   // Upload initial data to SSBO
   GLuint ssbo;
@@ -224,8 +508,25 @@ int main(void) {
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
+    // Physics runs in the publishing process
+    if (attachName) {
+      UploadLatestSnapshot(ssbo);
+      accumulator = 0.0;
+    }
+
     // Run physics updates at a fixed step
     while (accumulator >= fixedTimeStep) {
+      if (random_batch) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+        Particle *particle = (Particle *) glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_WRITE);
+        RBStep(particle, n_particles, deltaTime, rbSettings, simStep++);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        accumulator -= fixedTimeStep;
+        continue;
+      }
+
       // Bind SSBO for compute shader
       glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
 
@@ -255,11 +556,13 @@ int main(void) {
     glfwSwapBuffers(window);
     glfwPollEvents();
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-    Particle *particle = (Particle *) glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-    OCSetTarget(particle[0].position);
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if (!attachName) {
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+      Particle *particle = (Particle *) glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
+      OCSetTarget(particle[0].position);
+      glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
 
     auto end = std::chrono::high_resolution_clock::now();
 
@@ -279,6 +582,9 @@ int main(void) {
   // Cleanup
   glDeleteProgram(computeShader);
   glDeleteBuffers(1, &ssbo);
+  if (stagingBuffer != 0)
+    glDeleteBuffers(1, &stagingBuffer);
+  SMClose(channel);
   glfwTerminate();
 
   return 0;
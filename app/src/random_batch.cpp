@@ -0,0 +1,151 @@
+#include "random_batch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "cell_grid.h"
+#include "parallel.h"
+
+static uint64_t SplitMix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// counter based draw in [0, 1), no generator state to share between threads
+static double Uniform(uint64_t seed, uint64_t step, uint64_t cell, uint64_t k) {
+  uint64_t h = SplitMix64(seed);
+  h = SplitMix64(h ^ step);
+  h = SplitMix64(h ^ cell);
+  h = SplitMix64(h ^ k);
+  return (double) (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void RBComputeAccelerations(const Particle *particles, size_t n, glm::vec3 *acceleration,
+                            const RandomBatchSettings &settings, uint64_t step) {
+  if (n == 0)
+    return;
+
+  CellGrid grid;
+  CGBuild(grid, particles, n, settings.cutoff, 128, settings.threads);
+
+  double total_mass = 0.0;
+  for (size_t i = 0; i < n; i++)
+    total_mass += particles[i].position.w;
+
+  // particles heavier than one sample's share would dominate every batch,
+  // they are summed exactly and only the remaining mass is sampled
+  double heavy_mass = settings.batchSize > 0 ? total_mass / settings.batchSize : INFINITY;
+  std::vector<uint32_t> heavy;
+  std::vector<double> cdf(n);
+  double light_mass = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    if (particles[i].position.w >= heavy_mass)
+      heavy.push_back((uint32_t) i);
+    else
+      light_mass += particles[i].position.w;
+    cdf[i] = light_mass;
+  }
+
+  // positions in cell order for the near field sweep
+  std::vector<glm::vec3> sorted(n);
+  for (size_t s = 0; s < n; s++)
+    sorted[s] = glm::vec3(particles[grid.order[s]].position);
+
+  float weight = settings.batchSize > 0 ? (float) (settings.G * light_mass / settings.batchSize) : 0.0f;
+
+  ParallelFor(grid.occupied.size(), settings.threads, [&](size_t begin, size_t end, unsigned) {
+    std::vector<glm::vec3> batch;
+    std::vector<glm::vec4> exact; // far heavy particles, w = G * mass
+    batch.reserve(settings.batchSize);
+
+    for (size_t o = begin; o < end; o++) {
+      uint32_t cell = grid.occupied[o];
+      glm::ivec3 coord = CGCellCoord(grid, cell);
+      auto near = [&](size_t j) {
+        glm::ivec3 other = CGCellCoord(grid, grid.cellOf[j]);
+        return std::abs(other.x - coord.x) <= 1 && std::abs(other.y - coord.y) <= 1 &&
+               std::abs(other.z - coord.z) <= 1;
+      };
+
+      // heavy particles in the near field are already covered by the exact sweep
+      exact.clear();
+      for (uint32_t j : heavy)
+        if (!near(j))
+          exact.push_back(glm::vec4(glm::vec3(particles[j].position), settings.G * particles[j].position.w));
+
+      // draw this cells batch from the light mass, samples landing in the near field are covered exactly
+      batch.clear();
+      for (unsigned k = 0; k < settings.batchSize && light_mass > 0.0; k++) {
+        double u = Uniform(settings.seed, step, cell, k) * light_mass;
+        size_t j = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        j = std::min(j, n - 1);
+        if (near(j))
+          continue;
+        batch.push_back(glm::vec3(particles[j].position));
+      }
+
+      glm::ivec3 lo = glm::max(coord - glm::ivec3(1), glm::ivec3(0));
+      glm::ivec3 hi = glm::min(coord + glm::ivec3(1), grid.dims - glm::ivec3(1));
+
+      for (uint32_t s = grid.cellStart[cell]; s < grid.cellStart[cell + 1]; s++) {
+        glm::vec3 position = sorted[s];
+        glm::vec3 acc(0.0f);
+
+        // near field, exact as in nbody_c.glsl
+        for (int z = lo.z; z <= hi.z; z++) {
+          for (int y = lo.y; y <= hi.y; y++) {
+            for (int x = lo.x; x <= hi.x; x++) {
+              uint32_t neighbour = CGCellIndex(grid, glm::ivec3(x, y, z));
+              for (uint32_t t = grid.cellStart[neighbour]; t < grid.cellStart[neighbour + 1]; t++) {
+                if (t == s)
+                  continue;
+                glm::vec3 direction = sorted[t] - position;
+                float distanceSq = glm::dot(direction, direction);
+                if (distanceSq < 1e-6f)
+                  continue;
+                float mass = particles[grid.order[t]].position.w;
+                acc += direction * (settings.G * mass / (std::sqrt(distanceSq) * (distanceSq + 1e-6f)));
+              }
+            }
+          }
+        }
+
+        // far field, heavy particles exactly and each sample standing in for light_mass / batchSize
+        for (const glm::vec4 &body : exact) {
+          glm::vec3 direction = glm::vec3(body) - position;
+          float distanceSq = glm::dot(direction, direction);
+          if (distanceSq < 1e-6f)
+            continue;
+          acc += direction * (body.w / (std::sqrt(distanceSq) * (distanceSq + 1e-6f)));
+        }
+        for (const glm::vec3 &sample : batch) {
+          glm::vec3 direction = sample - position;
+          float distanceSq = glm::dot(direction, direction);
+          if (distanceSq < 1e-6f)
+            continue;
+          acc += direction * (weight / (std::sqrt(distanceSq) * (distanceSq + 1e-6f)));
+        }
+
+        acceleration[grid.order[s]] = acc;
+      }
+    }
+  });
+}
+
+void RBStep(Particle *particles, size_t n, float deltaTime, const RandomBatchSettings &settings,
+            uint64_t step) {
+  std::vector<glm::vec3> acceleration(n);
+  RBComputeAccelerations(particles, n, acceleration.data(), settings, step);
+
+  ParallelFor(n, settings.threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      glm::vec3 velocity = glm::vec3(particles[i].velocity) + acceleration[i] * deltaTime;
+      particles[i].velocity = glm::vec4(velocity, particles[i].velocity.w);
+      particles[i].position = glm::vec4(glm::vec3(particles[i].position) + velocity * deltaTime,
+                                        particles[i].position.w);
+    }
+  });
+}
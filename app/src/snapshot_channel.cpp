@@ -0,0 +1,175 @@
+#include "snapshot_channel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+static const uint64_t SNAPSHOT_MAGIC = 0x6e626f6479736e31ull; // "nbodysn1"
+
+static std::string ShmName(const char *name) {
+  return name[0] == '/' ? std::string(name) : "/" + std::string(name);
+}
+
+static size_t SlotHeaderBytes() {
+  return (sizeof(SnapshotSlot) + 15) & ~(size_t) 15;
+}
+
+static SnapshotHeader *Header(const SnapshotChannel &channel) {
+  return (SnapshotHeader *) channel.base;
+}
+
+static SnapshotSlot *Slot(const SnapshotChannel &channel, uint64_t generation) {
+  SnapshotHeader *header = Header(channel);
+  size_t offset = ((sizeof(SnapshotHeader) + 63) & ~(size_t) 63) +
+                  (generation % header->slotCount) * header->slotBytes;
+  return (SnapshotSlot *) ((uint8_t *) channel.base + offset);
+}
+
+static Particle *SlotParticles(SnapshotSlot *slot) {
+  return (Particle *) ((uint8_t *) slot + SlotHeaderBytes());
+}
+
+bool SMCreate(SnapshotChannel &channel, const char *name, uint32_t slots, uint32_t capacity) {
+  channel.name = ShmName(name);
+  channel.writer = true;
+  channel.generation = 0;
+
+  uint64_t slot_bytes = SlotHeaderBytes() + (uint64_t) capacity * sizeof(Particle);
+  slot_bytes = (slot_bytes + 63) & ~(uint64_t) 63;
+  channel.bytes = ((sizeof(SnapshotHeader) + 63) & ~(size_t) 63) + slots * slot_bytes;
+
+  shm_unlink(channel.name.c_str());
+  channel.fd = shm_open(channel.name.c_str(), O_CREAT | O_RDWR, 0644);
+  if (channel.fd < 0 || ftruncate(channel.fd, channel.bytes) != 0) {
+    std::cerr << "Error: Failed to create shared memory: " << channel.name << std::endl;
+    SMClose(channel);
+    return false;
+  }
+
+  channel.base = mmap(nullptr, channel.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, channel.fd, 0);
+  if (channel.base == MAP_FAILED) {
+    channel.base = nullptr;
+    std::cerr << "Error: Failed to map shared memory: " << channel.name << std::endl;
+    SMClose(channel);
+    return false;
+  }
+
+  // fresh pages are zero, so every slot sequence and latest start at 0
+  SnapshotHeader *header = Header(channel);
+  header->slotCount = slots;
+  header->slotCapacity = capacity;
+  header->slotBytes = slot_bytes;
+  header->latest.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = SNAPSHOT_MAGIC;
+  return true;
+}
+
+bool SMAttach(SnapshotChannel &channel, const char *name) {
+  channel.name = ShmName(name);
+  channel.writer = false;
+
+  channel.fd = shm_open(channel.name.c_str(), O_RDONLY, 0);
+  struct stat info;
+  if (channel.fd < 0 || fstat(channel.fd, &info) != 0 ||
+      (size_t) info.st_size < sizeof(SnapshotHeader)) {
+    std::cerr << "Error: Failed to open shared memory: " << channel.name << std::endl;
+    SMClose(channel);
+    return false;
+  }
+
+  channel.bytes = info.st_size;
+  channel.base = mmap(nullptr, channel.bytes, PROT_READ, MAP_SHARED, channel.fd, 0);
+  if (channel.base == MAP_FAILED || Header(channel)->magic != SNAPSHOT_MAGIC) {
+    if (channel.base == MAP_FAILED)
+      channel.base = nullptr;
+    std::cerr << "Error: Not a snapshot channel: " << channel.name << std::endl;
+    SMClose(channel);
+    return false;
+  }
+  return true;
+}
+
+void SMClose(SnapshotChannel &channel) {
+  if (channel.base)
+    munmap(channel.base, channel.bytes);
+  if (channel.fd >= 0)
+    close(channel.fd);
+  if (channel.writer && !channel.name.empty())
+    shm_unlink(channel.name.c_str());
+  channel.base = nullptr;
+  channel.fd = -1;
+  channel.writer = false; // unlink once, a second close must not remove a newer segment
+}
+
+void SMPublish(SnapshotChannel &channel, const Particle *particles, size_t n, uint64_t step,
+               double time, unsigned threads) {
+  SnapshotHeader *header = Header(channel);
+  uint64_t generation = ++channel.generation;
+  SnapshotSlot *slot = Slot(channel, generation);
+
+  // level of detail, keep every stride-th particle, particle 0 always included
+  uint32_t stride = (uint32_t) std::max<size_t>(1, (n + header->slotCapacity - 1) / header->slotCapacity);
+  uint32_t count = (uint32_t) ((n + stride - 1) / stride);
+
+  uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->generation = generation;
+  slot->step = step;
+  slot->time = time;
+  slot->totalParticles = n;
+  slot->count = count;
+  slot->stride = stride;
+
+  Particle *out = SlotParticles(slot);
+  if (stride == 1) {
+    ParallelFor(n, threads, [&](size_t begin, size_t end, unsigned) {
+      memcpy(out + begin, particles + begin, (end - begin) * sizeof(Particle));
+    });
+  } else {
+    ParallelFor(count, threads, [&](size_t begin, size_t end, unsigned) {
+      for (size_t i = begin; i < end; i++)
+        out[i] = particles[i * stride];
+    });
+  }
+
+  slot->sequence.store(sequence + 2, std::memory_order_release);
+  header->latest.store(generation, std::memory_order_release);
+}
+
+bool SMAcquire(const SnapshotChannel &channel, SnapshotView &view) {
+  SnapshotHeader *header = Header(channel);
+  uint64_t generation = header->latest.load(std::memory_order_acquire);
+  if (generation == 0)
+    return false;
+
+  SnapshotSlot *slot = Slot(channel, generation);
+  uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+  if (sequence & 1)
+    return false;
+
+  view.slot = slot;
+  view.sequence = sequence;
+  view.generation = slot->generation;
+  view.step = slot->step;
+  view.time = slot->time;
+  view.totalParticles = slot->totalParticles;
+  view.count = std::min(slot->count, header->slotCapacity);
+  view.stride = slot->stride;
+  view.particles = SlotParticles(slot);
+  return SMValid(view);
+}
+
+bool SMValid(const SnapshotView &view) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return view.slot->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
@@ -0,0 +1,170 @@
+#include "soft_render.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+
+// a projected point, x/y is the top left pixel of its footprint
+struct Splat {
+  int16_t x, y;
+  float speed;
+};
+
+static const int16_t CULLED = INT16_MIN;
+
+glm::vec3 SRSpeedColour(glm::vec3 velocity) {
+  float speed = glm::clamp(glm::length(velocity), 0.0f, 1.0f);
+  return glm::vec3(speed, 0.0f, 1.0f - (speed / 2));
+}
+
+static glm::vec3 SpeedColour(float speed) {
+  return glm::vec3(speed, 0.0f, 1.0f - (speed / 2));
+}
+
+static uint8_t ToByte(float v) {
+  return (uint8_t) (glm::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+void SRRender(const Particle *particles, size_t n, const glm::mat4 &view,
+              const glm::mat4 &projection, const SoftRenderSettings &settings, SoftFrame &frame) {
+  const int width = settings.width, height = settings.height;
+  const int size = std::max(settings.pointSize, 1);
+  const int tile = std::max(settings.tileSize, 8);
+  const int tiles_x = (width + tile - 1) / tile, tiles_y = (height + tile - 1) / tile;
+  const size_t n_tiles = (size_t) tiles_x * tiles_y;
+  const unsigned threads = (unsigned) std::min<size_t>(ThreadCount(settings.threads), std::max<size_t>(n, 1));
+  const glm::mat4 mvp = projection * view;
+
+  frame.width = width;
+  frame.height = height;
+  frame.rgb.resize((size_t) width * height * 3);
+
+  // scratch reused between frames
+  static thread_local std::vector<Splat> splats;
+  static thread_local std::vector<Splat> bins;
+  static thread_local std::vector<uint32_t> counts;
+  splats.resize(n);
+  counts.assign((size_t) threads * n_tiles, 0);
+
+  auto tile_range = [&](const Splat &s, int &tx0, int &tx1, int &ty0, int &ty1) {
+    tx0 = std::max<int>(s.x, 0) / tile;
+    tx1 = std::min<int>(s.x + size - 1, width - 1) / tile;
+    ty0 = std::max<int>(s.y, 0) / tile;
+    ty1 = std::min<int>(s.y + size - 1, height - 1) / tile;
+  };
+
+  // project and count per tile, one chunk of particles per thread
+  ParallelFor(n, threads, [&](size_t begin, size_t end, unsigned t) {
+    uint32_t *count = &counts[(size_t) t * n_tiles];
+    for (size_t i = begin; i < end; i++) {
+      Splat &s = splats[i];
+      s.x = CULLED;
+
+      glm::vec4 clip = mvp * glm::vec4(glm::vec3(particles[i].position), 1.0f);
+      if (clip.w <= 0.0f || std::abs(clip.x) > clip.w || std::abs(clip.y) > clip.w ||
+          std::abs(clip.z) > clip.w)
+        continue;
+
+      float px = (clip.x / clip.w * 0.5f + 0.5f) * width;
+      float py = (0.5f - clip.y / clip.w * 0.5f) * height;
+      int x0 = (int) std::floor(px - size * 0.5f + 0.5f);
+      int y0 = (int) std::floor(py - size * 0.5f + 0.5f);
+      if (x0 + size <= 0 || y0 + size <= 0 || x0 >= width || y0 >= height)
+        continue;
+
+      s.x = (int16_t) x0;
+      s.y = (int16_t) y0;
+      s.speed = glm::clamp(glm::length(glm::vec3(particles[i].velocity)), 0.0f, 1.0f);
+
+      int tx0, tx1, ty0, ty1;
+      tile_range(s, tx0, tx1, ty0, ty1);
+      for (int ty = ty0; ty <= ty1; ty++)
+        for (int tx = tx0; tx <= tx1; tx++)
+          count[ty * tiles_x + tx]++;
+    }
+  });
+
+  // bin offsets, tile major then thread so each bin keeps particle order
+  std::vector<size_t> tile_start(n_tiles + 1, 0);
+  std::vector<size_t> offsets((size_t) threads * n_tiles);
+  size_t total = 0;
+  for (size_t b = 0; b < n_tiles; b++) {
+    tile_start[b] = total;
+    for (unsigned t = 0; t < threads; t++) {
+      offsets[(size_t) t * n_tiles + b] = total;
+      total += counts[(size_t) t * n_tiles + b];
+    }
+  }
+  tile_start[n_tiles] = total;
+  bins.resize(total);
+
+  ParallelFor(n, threads, [&](size_t begin, size_t end, unsigned t) {
+    size_t *offset = &offsets[(size_t) t * n_tiles];
+    for (size_t i = begin; i < end; i++) {
+      const Splat &s = splats[i];
+      if (s.x == CULLED)
+        continue;
+      int tx0, tx1, ty0, ty1;
+      tile_range(s, tx0, tx1, ty0, ty1);
+      for (int ty = ty0; ty <= ty1; ty++)
+        for (int tx = tx0; tx <= tx1; tx++)
+          bins[offset[ty * tiles_x + tx]++] = s;
+    }
+  });
+
+  // splat each tile into a local buffer, tiles never share pixels
+  ParallelFor(n_tiles, threads, [&](size_t begin, size_t end, unsigned) {
+    std::vector<glm::vec4> buffer((size_t) tile * tile);
+    for (size_t b = begin; b < end; b++) {
+      int ox = (int) (b % tiles_x) * tile, oy = (int) (b / tiles_x) * tile;
+      int tw = std::min(tile, width - ox), th = std::min(tile, height - oy);
+      std::fill(buffer.begin(), buffer.end(), glm::vec4(0.0f));
+
+      for (size_t k = tile_start[b]; k < tile_start[b + 1]; k++) {
+        const Splat &s = bins[k];
+        int x0 = std::max(s.x - ox, 0), x1 = std::min(s.x + size - ox, tw);
+        int y0 = std::max(s.y - oy, 0), y1 = std::min(s.y + size - oy, th);
+        glm::vec3 colour = SpeedColour(s.speed);
+
+        for (int y = y0; y < y1; y++) {
+          glm::vec4 *row = &buffer[(size_t) y * tile];
+          for (int x = x0; x < x1; x++) {
+            switch (settings.blend) {
+            case SplatBlend::Overwrite:
+              row[x] = glm::vec4(colour, 1.0f);
+              break;
+            case SplatBlend::Accumulate:
+              row[x] += glm::vec4(colour, 1.0f);
+              break;
+            case SplatBlend::Density:
+              row[x].x += s.speed;
+              row[x].w += 1.0f;
+              break;
+            }
+          }
+        }
+      }
+
+      for (int y = 0; y < th; y++) {
+        uint8_t *out = &frame.rgb[((size_t) (oy + y) * width + ox) * 3];
+        for (int x = 0; x < tw; x++) {
+          glm::vec4 v = buffer[(size_t) y * tile + x];
+          glm::vec3 colour;
+          if (settings.blend == SplatBlend::Overwrite)
+            colour = glm::vec3(v);
+          else if (settings.blend == SplatBlend::Accumulate)
+            colour = glm::vec3(v) * settings.exposure;
+          else if (v.w > 0.0f)
+            colour = SpeedColour(v.x / v.w) * (settings.exposure * std::log2(1.0f + v.w));
+          else
+            colour = glm::vec3(0.0f);
+
+          out[x * 3 + 0] = ToByte(colour.x);
+          out[x * 3 + 1] = ToByte(colour.y);
+          out[x * 3 + 2] = ToByte(colour.z);
+        }
+      }
+    }
+  });
+}
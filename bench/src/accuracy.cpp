@@ -0,0 +1,492 @@
+#include <glm/glm.hpp>
+
+#include "force_kernel.h"
+#include "frame_writer.h"
+#include "initial_conditions.h"
+#include "parallel.h"
+#include "particle.h"
+#include "random_batch.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+// Accuracy versus cost for the cpu force paths. Every backend computes the
+// accelerations of the same seeded initial conditions, errors are relative
+// to an fp64 direct sum with the backend's own force law, so they measure
+// precision and approximation rather than differences between force laws.
+
+float G = 6.67430e-11f;
+float centralMass = 1e9f;
+
+unsigned int n_particles = 256 * 20;
+unsigned int seed = 1;
+unsigned int sampleEvery = 1; // reference cost is O(n^2), sample targets for large n
+int repeats = 3;
+unsigned threads = 0;
+std::string outputPrefix = "accuracy";
+std::vector<std::pair<std::string, double>> checks; // --check name=max_p99
+
+// force law of a backend and of the reference it is measured against
+enum class Law {
+  Shader, // nbody_c.glsl: 1 / (r^2 + 1e-6), pairs closer than 1e-3 skipped
+  None,
+  Plummer,
+  Spline,
+};
+
+struct Backend {
+  std::string name;
+  Law law;
+  std::function<void(const std::vector<Particle> &, std::vector<glm::vec3> &)> run;
+};
+
+struct Result {
+  std::string name;
+  double seconds;
+  double median, p99, max;
+  bool pareto;
+};
+
+// pair factor f such that a_i += G m_j f (x_j - x_i), in double
+static double ReferenceFactor(Law law, double r2, double eps) {
+  switch (law) {
+  case Law::Shader:
+    return r2 < 1e-6 ? 0.0 : 1.0 / (std::sqrt(r2) * (r2 + 1e-6));
+  case Law::None:
+    return r2 > 0.0 ? 1.0 / (r2 * std::sqrt(r2)) : 0.0;
+  case Law::Plummer:
+    return 1.0 / ((r2 + eps * eps) * std::sqrt(r2 + eps * eps));
+  case Law::Spline: {
+    double h = 2.8 * eps, r = std::sqrt(r2), u = r / h;
+    double h_inv3 = 1.0 / (h * h * h);
+    if (u < 0.5)
+      return h_inv3 * (32.0 / 3.0 + u * u * (32.0 * u - 38.4));
+    if (u < 1.0)
+      return h_inv3 *
+             (64.0 / 3.0 - 48.0 * u + 38.4 * u * u - 32.0 / 3.0 * u * u * u - 1.0 / (15.0 * u * u * u));
+    return 1.0 / (r2 * r);
+  }
+  }
+  return 0.0;
+}
+
+void ReferenceAccelerations(const std::vector<Particle> &particles, Law law,
+                            std::vector<glm::dvec3> &acceleration) {
+  const double eps = ForceKernelConfig().epsilon;
+  size_t n = particles.size();
+  size_t targets = (n + sampleEvery - 1) / sampleEvery;
+  acceleration.assign(targets, glm::dvec3(0.0));
+
+  ParallelFor(targets, threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t k = begin; k < end; k++) {
+      size_t i = k * sampleEvery;
+      glm::dvec3 position = glm::dvec3(glm::vec3(particles[i].position));
+      glm::dvec3 acc(0.0);
+      for (size_t j = 0; j < n; j++) {
+        if (i == j)
+          continue;
+        glm::dvec3 direction = glm::dvec3(glm::vec3(particles[j].position)) - position;
+        double distanceSq = glm::dot(direction, direction);
+        acc += direction * ((double) G * particles[j].position.w * ReferenceFactor(law, distanceSq, eps));
+      }
+      acceleration[k] = acc;
+    }
+  });
+}
+
+// nbody_c.glsl on the cpu, sqrt + normalize per pair
+void ShaderAccelerations(const std::vector<Particle> &particles,
+                         std::vector<glm::vec3> &acceleration) {
+  size_t n = particles.size();
+  ParallelFor(n, threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      glm::vec3 acc(0.0f);
+      for (size_t j = 0; j < n; j++) {
+        if (i == j)
+          continue;
+        glm::vec3 direction = glm::vec3(particles[j].position) - glm::vec3(particles[i].position);
+        float distanceSq = glm::dot(direction, direction);
+        if (distanceSq < 1e-6f)
+          continue;
+        float force = G * particles[i].position.w * particles[j].position.w / (distanceSq + 1e-6f);
+        acc += glm::normalize(direction) * (force / particles[i].position.w);
+      }
+      acceleration[i] = acc;
+    }
+  });
+}
+
+static float FastRsqrt(float x) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits = 0x5f375a86u - (bits >> 1);
+  float y;
+  memcpy(&y, &bits, sizeof(y));
+  return y * (1.5f - 0.5f * x * y * y);
+}
+
+// bit trick rsqrt with one newton step in place of sqrt + normalize
+void FastRsqrtAccelerations(const std::vector<Particle> &particles,
+                            std::vector<glm::vec3> &acceleration) {
+  size_t n = particles.size();
+  ParallelFor(n, threads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      glm::vec3 position = glm::vec3(particles[i].position);
+      glm::vec3 acc(0.0f);
+      for (size_t j = 0; j < n; j++) {
+        if (i == j)
+          continue;
+        glm::vec3 direction = glm::vec3(particles[j].position) - position;
+        float distanceSq = glm::dot(direction, direction);
+        if (distanceSq < 1e-6f)
+          continue;
+        acc += direction * (FastRsqrt(distanceSq) * G * particles[j].position.w / (distanceSq + 1e-6f));
+      }
+      acceleration[i] = acc;
+    }
+  });
+}
+
+std::vector<Backend> Backends() {
+  std::vector<Backend> backends;
+  backends.push_back({"shader_fp32", Law::Shader, ShaderAccelerations});
+  backends.push_back({"fast_rsqrt", Law::Shader, FastRsqrtAccelerations});
+
+  // the app's templated direct kernels, each against a reference with its softening
+  struct Variant {
+    const char *name;
+    Softening softening;
+    Law law;
+    bool fp64;
+  };
+  for (Variant variant : {Variant{"direct_none_fp32", Softening::None, Law::None, false},
+                          Variant{"direct_none_fp64", Softening::None, Law::None, true},
+                          Variant{"direct_plummer_fp32", Softening::Plummer, Law::Plummer, false},
+                          Variant{"direct_plummer_fp64", Softening::Plummer, Law::Plummer, true},
+                          Variant{"direct_spline_fp32", Softening::Spline, Law::Spline, false}}) {
+    backends.push_back({variant.name, variant.law, [variant](const std::vector<Particle> &particles,
+                                                std::vector<glm::vec3> &acc) {
+                          ForceKernelConfig config;
+                          config.softening = variant.softening;
+                          config.mass = DFDetectMassModel(particles.data(), particles.size());
+                          config.G = G;
+                          config.fp64 = variant.fp64;
+                          config.threads = threads;
+                          DirectForce force;
+                          DFInit(force, config);
+                          DFCompute(force, particles.data(), particles.size());
+                          for (size_t i = 0; i < particles.size(); i++)
+                            acc[i] = glm::vec3(force.arrays.ax[i], force.arrays.ay[i], force.arrays.az[i]);
+                        }});
+  }
+
+  for (unsigned batch : {8u, 32u, 128u, 512u}) {
+    backends.push_back({"random_batch_" + std::to_string(batch), Law::Shader,
+                        [batch](const std::vector<Particle> &particles, std::vector<glm::vec3> &acc) {
+                          RandomBatchSettings settings;
+                          settings.G = G;
+                          settings.batchSize = batch;
+                          settings.seed = seed;
+                          settings.threads = threads;
+                          RBComputeAccelerations(particles.data(), particles.size(), acc.data(),
+                                                 settings, 0);
+                        }});
+  }
+  return backends;
+}
+
+Result Measure(const Backend &backend, const std::vector<Particle> &particles,
+               const std::vector<glm::dvec3> &reference) {
+  std::vector<glm::vec3> acceleration(particles.size());
+
+  double best = INFINITY;
+  for (int r = 0; r < std::max(repeats, 1); r++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    backend.run(particles, acceleration);
+    auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(best, std::chrono::duration<double>(end - start).count());
+  }
+
+  std::vector<double> error;
+  error.reserve(reference.size());
+  for (size_t k = 0; k < reference.size(); k++) {
+    double magnitude = glm::length(reference[k]);
+    if (magnitude == 0.0)
+      continue;
+    glm::dvec3 difference = glm::dvec3(acceleration[k * sampleEvery]) - reference[k];
+    error.push_back(glm::length(difference) / magnitude);
+  }
+  std::sort(error.begin(), error.end());
+
+  Result result = {backend.name, best, 0.0, 0.0, 0.0, false};
+  if (!error.empty()) {
+    result.median = error[error.size() / 2];
+    result.p99 = error[std::min(error.size() - 1, (size_t) std::ceil(error.size() * 0.99) - 1)];
+    result.max = error.back();
+  }
+  return result;
+}
+
+// 5x7 bitmap font, enough for backend names and axis labels
+struct Glyph {
+  char c;
+  uint8_t rows[7]; // bit 4 is the leftmost column
+};
+
+static const Glyph font[] = {
+    {'a', {0x00, 0x00, 0x0e, 0x01, 0x0f, 0x11, 0x0f}},
+    {'b', {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1e}},
+    {'c', {0x00, 0x00, 0x0e, 0x10, 0x10, 0x11, 0x0e}},
+    {'d', {0x01, 0x01, 0x0d, 0x13, 0x11, 0x11, 0x0f}},
+    {'e', {0x00, 0x00, 0x0e, 0x11, 0x1f, 0x10, 0x0e}},
+    {'f', {0x06, 0x09, 0x08, 0x1c, 0x08, 0x08, 0x08}},
+    {'g', {0x0f, 0x11, 0x11, 0x0f, 0x01, 0x11, 0x0e}},
+    {'h', {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11}},
+    {'i', {0x04, 0x00, 0x0c, 0x04, 0x04, 0x04, 0x0e}},
+    {'j', {0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0c}},
+    {'k', {0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12}},
+    {'l', {0x0c, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}},
+    {'m', {0x00, 0x00, 0x1a, 0x15, 0x15, 0x11, 0x11}},
+    {'n', {0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11}},
+    {'o', {0x00, 0x00, 0x0e, 0x11, 0x11, 0x11, 0x0e}},
+    {'p', {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}},
+    {'q', {0x0f, 0x11, 0x11, 0x0f, 0x01, 0x01, 0x01}},
+    {'r', {0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10}},
+    {'s', {0x00, 0x00, 0x0e, 0x10, 0x0e, 0x01, 0x1e}},
+    {'t', {0x08, 0x08, 0x1c, 0x08, 0x08, 0x09, 0x06}},
+    {'u', {0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0d}},
+    {'v', {0x00, 0x00, 0x11, 0x11, 0x11, 0x0a, 0x04}},
+    {'w', {0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0a}},
+    {'x', {0x00, 0x00, 0x11, 0x0a, 0x04, 0x0a, 0x11}},
+    {'y', {0x11, 0x11, 0x11, 0x0f, 0x01, 0x11, 0x0e}},
+    {'z', {0x00, 0x00, 0x1f, 0x02, 0x04, 0x08, 0x1f}},
+    {'0', {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}},
+    {'1', {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}},
+    {'2', {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}},
+    {'3', {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}},
+    {'4', {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}},
+    {'5', {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}},
+    {'6', {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}},
+    {'7', {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}},
+    {'8', {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}},
+    {'9', {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}},
+    {'_', {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f}},
+    {'-', {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00}},
+    {'.', {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}},
+    {'(', {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}},
+    {')', {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}},
+    {',', {0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08}},
+    {'*', {0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00}},
+};
+
+static void PutPixel(SoftFrame &plot, int x, int y, glm::vec3 colour) {
+  if (x < 0 || y < 0 || x >= plot.width || y >= plot.height)
+    return;
+  uint8_t *pixel = &plot.rgb[((size_t) y * plot.width + x) * 3];
+  pixel[0] = (uint8_t) (colour.x * 255);
+  pixel[1] = (uint8_t) (colour.y * 255);
+  pixel[2] = (uint8_t) (colour.z * 255);
+}
+
+static void FillBox(SoftFrame &plot, int x, int y, int radius, glm::vec3 colour) {
+  for (int dy = -radius; dy <= radius; dy++)
+    for (int dx = -radius; dx <= radius; dx++)
+      PutPixel(plot, x + dx, y + dy, colour);
+}
+
+static void DrawLine(SoftFrame &plot, int x0, int y0, int x1, int y1, glm::vec3 colour) {
+  int steps = std::max(std::abs(x1 - x0), std::abs(y1 - y0));
+  for (int k = 0; k <= steps; k++) {
+    float t = steps > 0 ? (float) k / steps : 0.0f;
+    PutPixel(plot, (int) std::lround(x0 + t * (x1 - x0)), (int) std::lround(y0 + t * (y1 - y0)), colour);
+  }
+}
+
+// text at twice the font size, (x, y) is the top left corner
+static const int glyphWidth = 12, glyphHeight = 14;
+
+static void DrawText(SoftFrame &plot, int x, int y, const std::string &text, glm::vec3 colour) {
+  for (size_t k = 0; k < text.size(); k++) {
+    const Glyph *glyph = std::find_if(std::begin(font), std::end(font),
+                                      [&](const Glyph &g) { return g.c == text[k]; });
+    if (glyph == std::end(font))
+      continue;
+    int drop = strchr("gpqy", text[k]) ? 4 : 0; // descenders hang below the baseline
+    for (int row = 0; row < 7; row++)
+      for (int column = 0; column < 5; column++)
+        if (glyph->rows[row] & (0x10 >> column))
+          for (int d = 0; d < 4; d++)
+            PutPixel(plot, x + (int) k * glyphWidth + column * 2 + d % 2, y + drop + row * 2 + d / 2,
+                     colour);
+  }
+}
+
+// log-log scatter of p99 (large) and median (small) error against time,
+// points are numbered as in the legend and the pareto front is ringed and joined
+void PlotResults(const std::vector<Result> &results, const std::string &filename) {
+  const int width = 1040, height = 640;
+  const int left = 90, right = 700, top = 50, bottom = 570;
+  SoftFrame plot;
+  plot.width = width;
+  plot.height = height;
+  plot.rgb.assign((size_t) width * height * 3, 255);
+
+  double t_lo = INFINITY, t_hi = -INFINITY, e_lo = INFINITY, e_hi = -INFINITY;
+  for (const Result &r : results) {
+    t_lo = std::min(t_lo, std::floor(std::log10(r.seconds)));
+    t_hi = std::max(t_hi, std::ceil(std::log10(r.seconds)));
+    for (double e : {r.median, r.p99}) {
+      double l = std::log10(std::max(e, 1e-12));
+      e_lo = std::min(e_lo, std::floor(l));
+      e_hi = std::max(e_hi, std::ceil(l));
+    }
+  }
+  t_hi = std::max(t_hi, t_lo + 1);
+  e_hi = std::max(e_hi, e_lo + 1);
+
+  auto to_x = [&](double seconds) {
+    return left + (int) ((std::log10(seconds) - t_lo) / (t_hi - t_lo) * (right - left));
+  };
+  auto to_y = [&](double e) {
+    double l = std::log10(std::max(e, 1e-12));
+    return bottom - (int) ((l - e_lo) / (e_hi - e_lo) * (bottom - top));
+  };
+
+  // decade grid with tick values
+  const glm::vec3 grid(0.85f), ink(0.0f);
+  for (double d = t_lo; d <= t_hi; d++) {
+    int x = to_x(std::pow(10.0, d));
+    DrawLine(plot, x, top, x, bottom, grid);
+    std::string label = "1e" + std::to_string((int) d);
+    DrawText(plot, x - (int) label.size() * glyphWidth / 2, bottom + 8, label, ink);
+  }
+  for (double d = e_lo; d <= e_hi; d++) {
+    int y = to_y(std::pow(10.0, d));
+    DrawLine(plot, left, y, right, y, grid);
+    std::string label = "1e" + std::to_string((int) d);
+    DrawText(plot, left - 8 - (int) label.size() * glyphWidth, y - glyphHeight / 2, label, ink);
+  }
+  DrawLine(plot, left, top, left, bottom, ink);
+  DrawLine(plot, left, bottom, right, bottom, ink);
+  DrawText(plot, (left + right) / 2 - 9 * glyphWidth, bottom + 36, "time per evaluation (s)", ink);
+  DrawText(plot, left - 80, top - 36, "relative error, p99 (large) and median (small)", ink);
+
+  // distinct colours, cycled when there are more backends than entries
+  const glm::vec3 palette[] = {{0.12f, 0.47f, 0.71f}, {1.00f, 0.50f, 0.05f}, {0.17f, 0.63f, 0.17f},
+                               {0.84f, 0.15f, 0.16f}, {0.58f, 0.40f, 0.74f}, {0.55f, 0.34f, 0.29f},
+                               {0.89f, 0.47f, 0.76f}, {0.50f, 0.50f, 0.50f}, {0.74f, 0.74f, 0.13f},
+                               {0.09f, 0.75f, 0.81f}, {0.00f, 0.00f, 0.50f}, {0.50f, 0.00f, 0.00f}};
+  const size_t colours = sizeof(palette) / sizeof(palette[0]);
+
+  std::vector<const Result *> front;
+  for (const Result &r : results)
+    if (r.pareto)
+      front.push_back(&r);
+  std::sort(front.begin(), front.end(),
+            [](const Result *a, const Result *b) { return a->seconds < b->seconds; });
+  for (size_t k = 0; k + 1 < front.size(); k++)
+    DrawLine(plot, to_x(front[k]->seconds), to_y(front[k]->p99), to_x(front[k + 1]->seconds),
+             to_y(front[k + 1]->p99), glm::vec3(0.4f));
+
+  for (size_t b = 0; b < results.size(); b++) {
+    const Result &r = results[b];
+    glm::vec3 colour = palette[b % colours];
+    int x = to_x(r.seconds), y = to_y(r.p99);
+    DrawLine(plot, x, y, x, to_y(r.median), colour);
+    FillBox(plot, x, to_y(r.median), 2, colour);
+    if (r.pareto)
+      FillBox(plot, x, y, 7, ink);
+    FillBox(plot, x, y, 5, colour);
+    DrawText(plot, x + 9, y - glyphHeight, std::to_string(b + 1), colour);
+
+    // legend
+    int row = top + (int) b * (glyphHeight + 8);
+    DrawText(plot, right + 30, row, std::to_string(b + 1), colour);
+    FillBox(plot, right + 70, row + glyphHeight / 2, 5, colour);
+    DrawText(plot, right + 86, row, r.name + (r.pareto ? " *" : ""), ink);
+  }
+  DrawText(plot, right + 30, top + (int) results.size() * (glyphHeight + 8) + 8, "* pareto front", ink);
+
+  WritePng(filename, plot);
+}
+
+void ParseArguments(int argc, char **argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const char *arg = argv[i];
+    const char *value = argv[i + 1];
+    if (strcmp(arg, "--particles") == 0)
+      n_particles = atoi(value);
+    else if (strcmp(arg, "--seed") == 0)
+      seed = atoi(value);
+    else if (strcmp(arg, "--sample") == 0)
+      sampleEvery = std::max(1, atoi(value));
+    else if (strcmp(arg, "--repeats") == 0)
+      repeats = atoi(value);
+    else if (strcmp(arg, "--threads") == 0)
+      threads = atoi(value);
+    else if (strcmp(arg, "--out") == 0)
+      outputPrefix = value;
+    else if (strcmp(arg, "--check") == 0) {
+      const char *split = strchr(value, '=');
+      if (split)
+        checks.push_back({std::string(value, split), atof(split + 1)});
+    } else
+      std::cerr << "Unknown argument: " << arg << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  ParseArguments(argc, argv);
+
+  std::vector<Particle> particles = InitialiseParticles(n_particles, G, centralMass, seed);
+  // one reference per force law, computed when a backend first needs it
+  std::vector<std::vector<glm::dvec3>> references(4);
+  std::vector<Result> results;
+  for (const Backend &backend : Backends()) {
+    std::vector<glm::dvec3> &reference = references[(int) backend.law];
+    if (reference.empty())
+      ReferenceAccelerations(particles, backend.law, reference);
+    results.push_back(Measure(backend, particles, reference));
+  }
+
+  // pareto front: nothing else is both faster and at least as accurate
+  for (Result &r : results) {
+    r.pareto = true;
+    for (const Result &other : results)
+      if (&other != &r && other.seconds < r.seconds && other.p99 <= r.p99)
+        r.pareto = false;
+  }
+
+  std::ofstream csv(outputPrefix + ".csv");
+  csv << "backend,seconds,median,p99,max,pareto\n";
+  printf("%-20s %12s %12s %12s %12s\n", "backend", "ms", "median", "p99", "max");
+  for (const Result &r : results) {
+    csv << r.name << "," << r.seconds << "," << r.median << "," << r.p99 << "," << r.max << ","
+        << r.pareto << "\n";
+    printf("%-20s %12.3f %12.3e %12.3e %12.3e %s\n", r.name.c_str(), r.seconds * 1e3, r.median,
+           r.p99, r.max, r.pareto ? "*" : "");
+  }
+  PlotResults(results, outputPrefix + ".png");
+
+  // accuracy regressions fail the run
+  int failures = 0;
+  for (auto &[name, limit] : checks) {
+    auto r = std::find_if(results.begin(), results.end(),
+                          [&](const Result &result) { return result.name == name; });
+    if (r == results.end()) {
+      std::cerr << "Unknown backend in check: " << name << std::endl;
+      failures++;
+    } else if (r->p99 > limit) {
+      std::cerr << "FAIL " << name << ": p99 " << r->p99 << " > " << limit << std::endl;
+      failures++;
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}